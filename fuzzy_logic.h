@@ -8,6 +8,16 @@
 #include <cassert>
 #include <map>
 #include <stack>
+#include <vector>
+#include <string>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <limits>
 
 
 struct Range {
@@ -62,6 +72,239 @@ struct LinearPieceRange : LinearPiece {
 //};
 
 
+// Piecewise linear function given by breakpoints sorted by x, linear between them and constant outside.
+// Two breakpoints with the same x describe a jump.
+struct PiecewiseLinear {
+    struct Point {
+        double x, y;
+    };
+
+    std::vector<Point> points;
+
+    PiecewiseLinear() = default;
+
+    PiecewiseLinear(std::initializer_list<Point> points_) : points(points_) {
+        assert(std::is_sorted(points.begin(), points.end(),
+                              [](const Point & a, const Point & b) { return a.x < b.x; }));
+    }
+
+    double operator()(double x) const { return right(x); }
+
+    // Limit from the right at x (the value itself everywhere except jumps)
+    double right(double x) const {
+        if (points.empty()) return 0;
+        auto it = std::upper_bound(points.begin(), points.end(), x,
+                                   [](double value, const Point & p) { return value < p.x; });
+        if (it == points.begin()) return points.front().y;
+        if (it == points.end()) return points.back().y;
+        return _interpolate(*(it - 1), *it, x);
+    }
+
+    // Limit from the left at x
+    double left(double x) const {
+        if (points.empty()) return 0;
+        auto it = std::lower_bound(points.begin(), points.end(), x,
+                                   [](const Point & p, double value) { return p.x < value; });
+        if (it == points.begin()) return points.front().y;
+        if (it == points.end()) return points.back().y;
+        return _interpolate(*(it - 1), *it, x);
+    }
+
+    // Same function with breakpoints on the ends of universe and none outside of it
+    PiecewiseLinear restrict(const Range & universe) const {
+        PiecewiseLinear result;
+        result.points.push_back({ universe.l, right(universe.l) });
+        for (const auto & p : points) {
+            if (universe.l < p.x and p.x < universe.r) result.points.push_back(p);
+        }
+        result.points.push_back({ universe.r, left(universe.r) });
+        return result;
+    }
+
+    // Applies g to every value. g must be linear between consecutive levels of kinks,
+    // then the breakpoints where the function crosses those levels keep the result exact.
+    template <typename F>
+    PiecewiseLinear transform(const std::vector<double> & kinks, F g) const {
+        PiecewiseLinear result;
+        result.points.reserve(points.size() * (kinks.size() + 1));
+
+        std::vector<Point> crossings;
+        crossings.reserve(kinks.size());
+
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            const auto & p = points[i];
+            if (i > 0) {
+                const auto & prev = points[i - 1];
+                crossings.clear();
+                for (auto level : kinks) {
+                    if (prev.x < p.x and (prev.y - level) * (p.y - level) < 0) {
+                        auto t = (level - prev.y) / (p.y - prev.y);
+                        crossings.push_back({ prev.x + t * (p.x - prev.x), level });
+                    }
+                }
+                std::sort(crossings.begin(), crossings.end(),
+                          [](const Point & a, const Point & b) { return a.x < b.x; });
+                for (const auto & c : crossings) result.points.push_back({ c.x, g(c.y) });
+            }
+            result.points.push_back({ p.x, g(p.y) });
+        }
+        return result;
+    }
+
+    // Pointwise max (or min) of two functions restricted to the same universe.
+    // Breakpoints are merged in one pass and intersections of the segments are added.
+    static PiecewiseLinear combine(const PiecewiseLinear & f, const PiecewiseLinear & g, bool takeMax) {
+        assert(not f.points.empty() and not g.points.empty());
+        auto pick = [takeMax](double a, double b) { return takeMax ? std::max(a, b) : std::min(a, b); };
+
+        PiecewiseLinear result;
+        result.points.reserve(2 * (f.points.size() + g.points.size()));
+        auto push = [&result](Point p) {
+            if (result.points.empty() or result.points.back().x != p.x or result.points.back().y != p.y)
+                result.points.push_back(p);
+        };
+
+        std::size_t i = 0, j = 0, fk = 0, gk = 0;
+        std::optional<double> previous;
+        while (i < f.points.size() or j < g.points.size()) {
+            auto x = (j == g.points.size() or (i < f.points.size() and f.points[i].x <= g.points[j].x))
+                     ? f.points[i++].x : g.points[j++].x;
+            if (previous and *previous == x) continue;
+
+            if (previous) {
+                auto x0 = *previous;
+                auto [f0, f1] = _piece(f.points, fk, x0, x);
+                auto [g0, g1] = _piece(g.points, gk, x0, x);
+
+                push({ x0, pick(f0, g0) });
+                auto d0 = f0 - g0, d1 = f1 - g1;
+                if (d0 * d1 < 0) {
+                    auto t = d0 / (d0 - d1);
+                    push({ x0 + t * (x - x0), f0 + t * (f1 - f0) });
+                }
+                push({ x, pick(f1, g1) });
+            }
+            previous = x;
+        }
+
+        if (result.points.empty()) push({ *previous, pick(f.right(*previous), g.right(*previous)) });
+        return result;
+    }
+
+    // Approximation by uniform samples, for functions that are not piecewise linear
+    template <typename F>
+    static PiecewiseLinear sample(F func, const Range & universe, std::size_t count) {
+        assert(count >= 2);
+        PiecewiseLinear result;
+        result.points.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            auto x = universe.l + (universe.r - universe.l) * static_cast<double>(i) / static_cast<double>(count - 1);
+            result.points.push_back({ x, func(x) });
+        }
+        return result;
+    }
+
+    double area() const {
+        double sum = 0;
+        for (std::size_t i = 1; i < points.size(); ++i) {
+            const auto & a = points[i - 1], & b = points[i];
+            sum += (b.x - a.x) * (a.y + b.y) / 2;
+        }
+        return sum;
+    }
+
+    double centroid() const {
+        double moment = 0, sum = 0;
+        for (std::size_t i = 1; i < points.size(); ++i) {
+            const auto & a = points[i - 1], & b = points[i];
+            auto w = b.x - a.x;
+            moment += w * (a.x * (2 * a.y + b.y) + b.x * (a.y + 2 * b.y)) / 6;
+            sum += w * (a.y + b.y) / 2;
+        }
+        if (sum <= 0) throw std::runtime_error("Empty fuzzy set!");
+        return moment / sum;
+    }
+
+    // Point splitting the area under the function in half
+    double bisector() const {
+        auto half = area() / 2;
+        if (half <= 0) throw std::runtime_error("Empty fuzzy set!");
+
+        double sum = 0;
+        for (std::size_t i = 1; i < points.size(); ++i) {
+            const auto & a = points[i - 1], & b = points[i];
+            auto w = b.x - a.x;
+            if (w <= 0) continue;
+            auto segment = w * (a.y + b.y) / 2;
+            if (sum + segment < half) {
+                sum += segment;
+                continue;
+            }
+
+            // a.y * s + k * s^2 / 2 = target
+            auto target = half - sum;
+            auto k = (b.y - a.y) / w;
+            if (std::abs(k) < 1e-12) return a.x + target / a.y;
+            auto s = (-a.y + std::sqrt(std::max(0., a.y * a.y + 2 * k * target))) / k;
+            return a.x + std::clamp(s, 0., w);
+        }
+        return points.back().x;
+    }
+
+    double smallestOfMaxima() const { return _maxima().front().l; }
+
+    double largestOfMaxima() const { return _maxima().back().r; }
+
+    // Mean over the plateaus of the maximum, or over the separate points if there are no plateaus
+    double meanOfMaxima() const {
+        auto maxima = _maxima();
+        double length = 0, moment = 0, pointsSum = 0;
+        for (const auto & range : maxima) {
+            length += range.r - range.l;
+            moment += (range.r * range.r - range.l * range.l) / 2;
+            pointsSum += range.l;
+        }
+        if (length > 0) return moment / length;
+        return pointsSum / static_cast<double>(maxima.size());
+    }
+
+private:
+    static double _interpolate(const Point & a, const Point & b, double x) {
+        return a.y + (b.y - a.y) * (x - a.x) / (b.x - a.x);
+    }
+
+    // Values at x0 and x1 of the piece of points that is linear on (x0, x1).
+    // k only moves forward, so walking increasing x0 over all points is linear.
+    static std::pair<double, double> _piece(const std::vector<Point> & points, std::size_t & k, double x0, double x1) {
+        while (k + 1 < points.size() and points[k + 1].x <= x0) ++k;
+        if (k + 1 == points.size() or x0 < points[k].x) return { points[k].y, points[k].y };
+        return { _interpolate(points[k], points[k + 1], x0), _interpolate(points[k], points[k + 1], x1) };
+    }
+
+    // Ranges (possibly single points) where the maximum is reached, sorted by x
+    std::vector<Range> _maxima() const {
+        if (points.empty()) throw std::runtime_error("Empty fuzzy set!");
+
+        double top = points.front().y;
+        for (const auto & p : points) top = std::max(top, p.y);
+        if (top <= 0) throw std::runtime_error("Empty fuzzy set!");
+
+        auto isTop = [top](const Point & p) { return std::abs(p.y - top) <= 1e-9; };
+
+        std::vector<Range> result;
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            if (not isTop(points[i])) continue;
+            auto x = points[i].x;
+            if (i > 0 and isTop(points[i - 1]) and not result.empty()) {
+                result.back().r = x;
+            } else {
+                result.push_back({ x, x });
+            }
+        }
+        return result;
+    }
+};
+
 
 class FunctionBuilder {
     double _start, _end;
@@ -103,34 +346,73 @@ public:
 };
 
 class IDefuzzifier {
+public:
     virtual double implication(double a, double b) = 0;
+
+    // Levels of b at which implication(a, b) changes slope. Empty optional if it is not piecewise linear in b,
+    // then the output is defuzzified by sampling.
+    virtual std::optional<std::vector<double>> linearKinks(double /*a*/) { return std::nullopt; }
+
+    // Implications are joined by min, Mamdani-style clipping and scaling by max
+    virtual bool aggregatesByIntersection() { return true; }
+
+    virtual ~IDefuzzifier() = default;
 };
 
 class ZadehDefuzzifier : public IDefuzzifier {
+public:
     double implication(double a, double b) override { return std::max(std::min(a, b), 1 - a); }
+    std::optional<std::vector<double>> linearKinks(double a) override { return std::vector<double>{ a, 1 - a }; }
     /*
      * if (a <= 0.5) return 1 - a;
      * return [1-a, a];
      */
 };
 class LukaszewiczDefuzzifier : public IDefuzzifier {
+public:
     double implication(double a, double b) override { return std::min(1 - a + b, 1.); }
+    std::optional<std::vector<double>> linearKinks(double a) override { return std::vector<double>{ a }; }
 };
 class GauguinDefuzzifier : public IDefuzzifier {
+public:
     double implication(double a, double b) override { return std::min(a / b, 1.); }
 };
+class MamdaniDefuzzifier : public IDefuzzifier {
+public:
+    double implication(double a, double b) override { return std::min(a, b); }
+    std::optional<std::vector<double>> linearKinks(double a) override { return std::vector<double>{ a }; }
+    bool aggregatesByIntersection() override { return false; }
+};
+class LarsenDefuzzifier : public IDefuzzifier {
+public:
+    double implication(double a, double b) override { return a * b; }
+    std::optional<std::vector<double>> linearKinks(double /*a*/) override { return std::vector<double>{ }; }
+    bool aggregatesByIntersection() override { return false; }
+};
+
+enum class Defuzzification {
+    Centroid, Bisector, MeanOfMaxima, SmallestOfMaxima, LargestOfMaxima
+};
 
 class LinguisticVariable;
 
 class Term {
 private:
     std::string _name;
+    std::shared_ptr<const PiecewiseLinear> _shape;
     std::function<double(double)> _func;
 public:
     Term(std::string name, std::function<double(double)> func) : _name(std::move(name)), _func(std::move(func)) { }
 
+    Term(std::string name, const PiecewiseLinear & shape) : _name(std::move(name)),
+                                                            _shape(std::make_shared<const PiecewiseLinear>(shape)),
+                                                            _func([s = _shape](double x) { return (*s)(x); }) { }
+
     std::string getName() const { return _name; }
 
+    // Breakpoints of the membership function if it is piecewise linear, nullptr otherwise
+    const PiecewiseLinear * getShape() const { return _shape.get(); }
+
     bool operator==(const Term & another) const {
         return this->_name == another._name;
     }
@@ -330,39 +612,39 @@ struct std::hash<VarIsTerm> {
     }
 };
 
-void print(const std::shared_ptr<Rule> & rule) {
+void print(const std::shared_ptr<Rule> & rule, std::ostream & out = std::cout) {
     if (rule->type == Rule::Type::Implication) {
         auto r = std::dynamic_pointer_cast<ImplicationRule>(rule);
-        std::cout << "Если [";
-        print(r->a);
-        std::cout << "], ТО ";
-        print(r->b);
+        out << "Если [";
+        print(r->a, out);
+        out << "], ТО ";
+        print(r->b, out);
     } else if (rule->type == Rule::Type::And) {
         auto r = std::dynamic_pointer_cast<AndRule>(rule);
-        std::cout << "(";
-        print(r->a);
-        std::cout << " И ";
-        print(r->b);
-        std::cout << ")";
+        out << "(";
+        print(r->a, out);
+        out << " И ";
+        print(r->b, out);
+        out << ")";
     } else if (rule->type == Rule::Type::Or) {
         auto r = std::dynamic_pointer_cast<OrRule>(rule);
-        std::cout << "(";
-        print(r->a);
-        std::cout << " ИЛИ ";
-        print(r->b);
-        std::cout << ")";
+        out << "(";
+        print(r->a, out);
+        out << " ИЛИ ";
+        print(r->b, out);
+        out << ")";
     } else if (rule->type == Rule::Type::Not) {
         auto r = std::dynamic_pointer_cast<NotRule>(rule);
-        std::cout << "( НЕ ";
-        print(r->a);
-        std::cout << ")";
+        out << "( НЕ ";
+        print(r->a, out);
+        out << ")";
     } else if (rule->type == Rule::Type::VarIsTerm) {
         auto r = std::dynamic_pointer_cast<VarIsTermRule>(rule);
-        std::cout << "(";
-        std::cout << r->var.getName();
-        std::cout << " = ";
-        std::cout << r->term.getName();
-        std::cout << ")";
+        out << "(";
+        out << r->var.getName();
+        out << " = ";
+        out << r->term.getName();
+        out << ")";
     }
 
 }
@@ -375,6 +657,8 @@ private:
         const LinguisticVariable & var;
         std::shared_ptr<IRuleAggregation> ruleAggregation;
         std::shared_ptr<IDefuzzifier> defuzzifier;
+        Range universe;
+        Defuzzification method;
     };
 
     std::vector<Output> outputs;
@@ -382,13 +666,20 @@ private:
     std::vector<std::shared_ptr<Rule>> rules;
 
 public:
+    // Sample count used when the output terms or the implication are not piecewise linear
+    static constexpr std::size_t fallbackSamples = 1001;
+
     void addInputVariable(const LinguisticVariable & var) {
         inputVariables.push_back(var);
     }
 
+    // Without universe it is taken from the breakpoints of the piecewise linear terms of var,
+    // throws if var has none
     void addOutputVariable(const LinguisticVariable & var, std::shared_ptr<IRuleAggregation> ruleAggregation,
-                           std::shared_ptr<IDefuzzifier> defuzzifier) {
-        outputs.push_back({ var, std::move(ruleAggregation), std::move(defuzzifier) });
+                           std::shared_ptr<IDefuzzifier> defuzzifier, std::optional<Range> universe = std::nullopt,
+                           Defuzzification method = Defuzzification::Centroid) {
+        outputs.push_back({ var, std::move(ruleAggregation), std::move(defuzzifier),
+                            universe ? *universe : _universeOf(var), method });
     }
 
     void addRule(const RuleComposer & ruleComposer) {
@@ -397,7 +688,7 @@ public:
         rules.push_back(rule);
     }
 
-    bool checkBase() {
+    bool checkBase() const {
         for (const auto & output : outputs) {
             if (not _checkBaseVar(output.var, false)) return false;
         }
@@ -409,8 +700,10 @@ public:
         return true;
     }
 
-    void process(const std::vector<std::tuple<const LinguisticVariable &, double>> & data) {
-        _checkInputData(data);
+    // Writes membership degrees and rule activations to trace if it is given
+    std::map<std::string, double> process(const std::vector<std::tuple<const LinguisticVariable &, double>> & data,
+                                          std::ostream * trace = nullptr) const {
+        _assertInputData(data);
 
         // fuzzification
         std::unordered_map<VarIsTerm, double> fuzzification_results{ };
@@ -420,38 +713,104 @@ public:
                 auto membershipDegree = term(value);
                 fuzzification_results.insert({{ variable, term }, membershipDegree });
 
-                std::cout << variable.getName() << "(" << value << ") = \"\\text{" << term.getName() << "}\", \\mu_{\\widetilde{"
-                          << term.getName() << "}} (" << value << ") = " << membershipDegree << std::endl;
+                if (trace) {
+                    *trace << variable.getName() << "(" << value << ") = \"\\text{" << term.getName() << "}\", \\mu_{\\widetilde{"
+                           << term.getName() << "}} (" << value << ") = " << membershipDegree << std::endl;
+                }
             }
         }
 
         // aggregation
 
-        for (auto [outputVariable, ruleAggregation, defuzzifier] : outputs) {
+        std::map<std::string, double> results{ };
+
+        for (const auto & [outputVariable, ruleAggregation, defuzzifier, universe, method] : outputs) {
 
-            std::unordered_map<std::shared_ptr<Rule>, double> aggregation_results{ };
+            std::vector<double> aggregation_results{ };
+            aggregation_results.reserve(rules.size());
             for (const auto & rule : rules) {
                 auto r = std::dynamic_pointer_cast<ImplicationRule>(rule);
-                double uncertaintyDegree = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results);
+                double uncertaintyDegree = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results, trace);
 
-//                std::cout << "\n";
-                print(rule);
-                std::cout << "  :  " << uncertaintyDegree << std::endl;
+                if (trace) {
+                    print(rule, *trace);
+                    *trace << "  :  " << uncertaintyDegree << std::endl;
+                }
 
-                aggregation_results.insert({ rule, uncertaintyDegree });
+                aggregation_results.push_back(uncertaintyDegree);
             }
 
-            //
-
+            // defuzzification
 
+            auto aggregated = _aggregateOutput(outputVariable, *defuzzifier, universe, aggregation_results);
+            results.insert({ outputVariable.getName(), _defuzzify(aggregated, method) });
         }
+
+        return results;
     }
 
 private:
 
+    // Output fuzzy set built from the implications of all rules concluding about outputVariable.
+    // Piecewise linear terms give the exact set, other terms are sampled over universe.
+    // Rules are folded in the order they were added, so the result is reproducible.
+    PiecewiseLinear _aggregateOutput(const LinguisticVariable & outputVariable, IDefuzzifier & defuzzifier,
+                                     const Range & universe, const std::vector<double> & aggregation_results) const {
+        std::optional<PiecewiseLinear> result;
+
+        for (std::size_t i = 0; i < rules.size(); ++i) {
+            auto activation = aggregation_results[i];
+            auto r = std::dynamic_pointer_cast<ImplicationRule>(rules[i]);
+            if (r->b->type != Rule::Type::VarIsTerm) {
+                throw std::runtime_error("Unexpected consequent rule!");
+            }
+            auto consequent = std::dynamic_pointer_cast<VarIsTermRule>(r->b);
+            if (not (consequent->var == outputVariable)) continue;
+
+            const auto & term = consequent->term;
+            auto implication = [&defuzzifier, a = activation](double b) { return defuzzifier.implication(a, b); };
+
+            auto kinks = defuzzifier.linearKinks(activation);
+            auto implied = (term.getShape() and kinks)
+                           ? term.getShape()->restrict(universe).transform(*kinks, implication)
+                           : PiecewiseLinear::sample([&](double x) { return implication(term(x)); },
+                                                     universe, fallbackSamples);
+
+            result = result ? PiecewiseLinear::combine(*result, implied, not defuzzifier.aggregatesByIntersection())
+                            : implied;
+        }
+
+        if (not result) throw std::runtime_error("No rules for output variable!");
+        return *result;
+    }
+
+    static Range _universeOf(const LinguisticVariable & variable) {
+        std::optional<Range> universe;
+        for (const auto & term : variable.getTerms().get()) {
+            auto shape = term.getShape();
+            if (not shape or shape->points.empty()) continue;
+            Range range{ shape->points.front().x, shape->points.back().x };
+            universe = universe ? Range{ std::min(universe->l, range.l), std::max(universe->r, range.r) } : range;
+        }
+        if (not universe) throw std::runtime_error("Universe is unknown!");
+        return *universe;
+    }
+
+    static double _defuzzify(const PiecewiseLinear & aggregated, Defuzzification method) {
+        switch (method) {
+            case Defuzzification::Centroid: return aggregated.centroid();
+            case Defuzzification::Bisector: return aggregated.bisector();
+            case Defuzzification::MeanOfMaxima: return aggregated.meanOfMaxima();
+            case Defuzzification::SmallestOfMaxima: return aggregated.smallestOfMaxima();
+            case Defuzzification::LargestOfMaxima: return aggregated.largestOfMaxima();
+        }
+        throw std::runtime_error("Unexpected defuzzification method!");
+    }
+
     static double _applyAggregationRule(const std::shared_ptr<Rule>& rule,
                                         const std::shared_ptr<IRuleAggregation>& ruleAggregation,
-                                        const std::unordered_map<VarIsTerm, double>& fuzzification_results) {
+                                        const std::unordered_map<VarIsTerm, double>& fuzzification_results,
+                                        std::ostream * trace) {
 
         if (rule->type == Rule::Type::Implication) {
             throw std::runtime_error("Unexpected implication rule!");
@@ -460,17 +819,17 @@ private:
             auto r = std::dynamic_pointer_cast<VarIsTermRule>(rule);
             auto x = fuzzification_results.at({ r->var, r->term});
 //            std::cout << "(" << r->var.getName() << " == " << r->term.getName() << " : " << x << " )";
-            std::cout << x;
+            if (trace) *trace << x;
             return x;
         }
         if (rule->type == Rule::Type::And) {
             auto r = std::dynamic_pointer_cast<AndRule>(rule);
 
-            std::cout << "min(";
-            auto a = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results);
-            std::cout << ", ";
-            auto b = _applyAggregationRule(r->b, ruleAggregation, fuzzification_results);
-            std::cout << ")";
+            if (trace) *trace << "min(";
+            auto a = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results, trace);
+            if (trace) *trace << ", ";
+            auto b = _applyAggregationRule(r->b, ruleAggregation, fuzzification_results, trace);
+            if (trace) *trace << ")";
 
             auto res = ruleAggregation->And(a, b);
 //            std::cout << ":" << res;
@@ -480,11 +839,11 @@ private:
         if (rule->type == Rule::Type::Or) {
             auto r = std::dynamic_pointer_cast<OrRule>(rule);
 
-            std::cout << "max(";
-            auto a = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results);
-            std::cout << ", ";
-            auto b = _applyAggregationRule(r->b, ruleAggregation, fuzzification_results);
-            std::cout << ")";
+            if (trace) *trace << "max(";
+            auto a = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results, trace);
+            if (trace) *trace << ", ";
+            auto b = _applyAggregationRule(r->b, ruleAggregation, fuzzification_results, trace);
+            if (trace) *trace << ")";
 
             auto res = ruleAggregation->Or(a, b);
 //            std::cout << ":" << res;
@@ -495,7 +854,7 @@ private:
             auto r = std::dynamic_pointer_cast<OrRule>(rule);
 
 //            std::cout << "[ not ";
-            auto a = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results);
+            auto a = _applyAggregationRule(r->a, ruleAggregation, fuzzification_results, trace);
 //            std::cout << "]";
 
             auto res = ruleAggregation->Not(a);
@@ -507,7 +866,7 @@ private:
         throw std::runtime_error("Unexpected rule!");
     }
 
-    void _assertInputData(const std::vector<std::tuple<const LinguisticVariable &, double>> & data) {
+    void _assertInputData(const std::vector<std::tuple<const LinguisticVariable &, double>> & data) const {
         for (auto [variable, value] : data) {
             assert(contains(inputVariables, variable));
         }
@@ -524,7 +883,7 @@ private:
         }
     }
 
-    bool _checkBaseVar(const LinguisticVariable & linguisticVariable, bool check_in_left) {
+    bool _checkBaseVar(const LinguisticVariable & linguisticVariable, bool check_in_left) const {
         for (const auto & term : linguisticVariable.getTerms().get()) {
             bool isPresentInAnyRule = false;
             for (const auto & rule : rules) {
@@ -549,4 +908,161 @@ private:
 
 };
 
+// Versioned handle to a fully built engine, replaceable while other threads run inference.
+// Readers announce the epoch they started in and never lock; publish() retires the previous engine
+// and deletes it once no reader announced an epoch older than its retirement.
+// Rules of the engines keep references to the linguistic variables, those must outlive the handle.
+class FuzzyModelHandle {
+public:
+    // Reader slots are allocated in blocks of this size. When every slot is taken, read() appends
+    // another block, so the number of concurrent readers is not limited. Blocks live as long as the handle.
+    static constexpr std::size_t readersPerBlock = 64;
+
+    class ReadGuard {
+    private:
+        std::atomic<std::uint64_t> * _slot;
+        const FuzzyLogicEngine * _engine;
+
+    public:
+        ReadGuard(std::atomic<std::uint64_t> * slot, const FuzzyLogicEngine * engine) : _slot(slot), _engine(engine) { }
+
+        ReadGuard(ReadGuard && another) noexcept : _slot(another._slot), _engine(another._engine) {
+            another._slot = nullptr;
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard & operator=(const ReadGuard &) = delete;
+
+        ~ReadGuard() {
+            if (_slot) _slot->store(0, std::memory_order_release);
+        }
+
+        const FuzzyLogicEngine & operator*() const { return *_engine; }
+
+        const FuzzyLogicEngine * operator->() const { return _engine; }
+    };
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch{ 0 };  // 0 if free
+    };
+
+    struct SlotBlock {
+        Slot slots[readersPerBlock];
+        std::atomic<SlotBlock *> next{ nullptr };
+    };
+
+    struct Retired {
+        const FuzzyLogicEngine * engine;
+        std::uint64_t epoch;
+    };
+
+    mutable SlotBlock _slots;
+    std::atomic<const FuzzyLogicEngine *> _current;
+    std::atomic<std::uint64_t> _epoch{ 1 };
+
+    std::mutex _publishMutex;
+    std::vector<Retired> _retired;
+
+    // Spreads threads over the slots, so that they don't contend on the same cache lines
+    static inline std::atomic<std::size_t> _nextThread{ 0 };
+
+public:
+    explicit FuzzyModelHandle(std::unique_ptr<const FuzzyLogicEngine> engine) : _current(engine.release()) {
+        assert(_current.load() != nullptr);
+    }
+
+    FuzzyModelHandle(const FuzzyModelHandle &) = delete;
+    FuzzyModelHandle & operator=(const FuzzyModelHandle &) = delete;
+
+    // No reader may be active at destruction
+    ~FuzzyModelHandle() {
+        for (const auto & retired : _retired) delete retired.engine;
+        delete _current.load();
+
+        for (auto block = _slots.next.load(); block != nullptr;) {
+            auto next = block->next.load();
+            delete block;
+            block = next;
+        }
+    }
+
+    // Pins the current engine until the guard is destroyed
+    ReadGuard read() const {
+        thread_local const std::size_t home = _nextThread.fetch_add(1, std::memory_order_relaxed) % readersPerBlock;
+
+        SlotBlock * last = nullptr;
+        for (auto block = &_slots; block != nullptr; block = block->next.load()) {
+            for (std::size_t i = 0; i < readersPerBlock; ++i) {
+                auto & slot = block->slots[(home + i) % readersPerBlock];
+                std::uint64_t expected = 0;
+                if (slot.epoch.load(std::memory_order_relaxed) == 0 and
+                    slot.epoch.compare_exchange_strong(expected, _epoch.load())) {
+                    return { &slot.epoch, _current.load() };
+                }
+            }
+            last = block;
+        }
+
+        // Every slot is taken: the new block is linked with our slot already announced,
+        // so a writer either sees the announcement or the engine we load is already the new one
+        auto block = new SlotBlock;
+        auto & slot = block->slots[home].epoch;
+        slot.store(_epoch.load());
+        for (;;) {
+            SlotBlock * expected = nullptr;
+            if (last->next.compare_exchange_strong(expected, block)) break;
+            last = expected;
+        }
+        return { &slot, _current.load() };
+    }
+
+    std::map<std::string, double> process(const std::vector<std::tuple<const LinguisticVariable &, double>> & data) const {
+        auto engine = read();
+        return engine->process(data);
+    }
+
+    // Makes engine current for new readers, returns its version
+    std::uint64_t publish(std::unique_ptr<const FuzzyLogicEngine> engine) {
+        assert(engine != nullptr);
+        std::lock_guard lock(_publishMutex);
+
+        // The previous engine must be recorded once it is unpublished, so allocate first
+        _retired.reserve(_retired.size() + 1);
+
+        auto previous = _current.exchange(engine.release());
+        auto epoch = _epoch.fetch_add(1);
+        _retired.push_back({ previous, epoch });
+
+        _reclaim();
+        return epoch + 1;
+    }
+
+    std::uint64_t version() const { return _epoch.load(); }
+
+    // Deletes retired engines no reader can still use
+    void reclaim() {
+        std::lock_guard lock(_publishMutex);
+        _reclaim();
+    }
+
+private:
+    void _reclaim() {
+        auto oldest = std::numeric_limits<std::uint64_t>::max();
+        for (auto block = &_slots; block != nullptr; block = block->next.load()) {
+            for (const auto & slot : block->slots) {
+                auto epoch = slot.epoch.load();
+                if (epoch != 0) oldest = std::min(oldest, epoch);
+            }
+        }
+
+        // Readers with an epoch after the retirement loaded the pointer after the exchange
+        std::erase_if(_retired, [oldest](const Retired & retired) {
+            if (retired.epoch >= oldest) return false;
+            delete retired.engine;
+            return true;
+        });
+    }
+};
+
 #endif //FUZZYLOGIC_FUZZY_LOGIC_H
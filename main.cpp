@@ -98,9 +98,9 @@ int main() {
     });
 
     auto mode = LinguisticVariable("Z", {
-            { "низкая",  [](double x) -> double { return lined(x, 14, 16, 1, 0); }},
-            { "средняя", [](double x) -> double { return (x <= 17) ? lined(x, 13, 17, 0, 1) : lined(x, 18, 25, 1, 0); }},
-            { "высокая", [](double x) -> double { return lined(x, 17, 21, 0, 1); }},
+            { "низкая",  PiecewiseLinear{{ 14, 1 }, { 16, 0 }}},
+            { "средняя", PiecewiseLinear{{ 13, 0 }, { 17, 1 }, { 18, 1 }, { 25, 0 }}},
+            { "высокая", PiecewiseLinear{{ 17, 0 }, { 21, 1 }}},
     });
 
     FuzzyLogicEngine engine;
@@ -127,13 +127,17 @@ int main() {
 
     std::cout << (day * month) % 10 + 0.8 << " "
               << day + 9 << " "
-              << day + month + 8 << std::endl,
+              << day + month + 8 << std::endl;
 
-    engine.process({
-                           { power, (day * month) % 10 + 0.8 },
-                           { temperature, day + 9 },
-                           { room, day + month + 8 },
-                   });
+    auto results = engine.process({
+                                          { power, (day * month) % 10 + 0.8 },
+                                          { temperature, day + 9 },
+                                          { room, day + month + 8 },
+                                  }, &std::cout);
+
+    for (const auto & [name, value] : results) {
+        std::cout << name << " = " << value << std::endl;
+    }
 
     return 0;
 }
@@ -0,0 +1,143 @@
+#include "fuzzy_logic.h"
+
+// Checks the closed-form defuzzification of piecewise linear terms against values computed by hand,
+// and against the sampling fallback used for the same terms given as plain functions.
+
+static LinguisticVariable activation(const std::string & name) {
+    return { name, {{ "да", PiecewiseLinear{{ 0, 0 }, { 1, 1 }}}}};
+}
+
+int main() {
+    auto a1 = activation("A1"), a2 = activation("A2"), a3 = activation("A3");
+
+    auto exact = LinguisticVariable("Z", {
+            { "низкая",  PiecewiseLinear{{ 14, 1 }, { 16, 0 }}},
+            { "средняя", PiecewiseLinear{{ 13, 0 }, { 17, 1 }, { 18, 1 }, { 25, 0 }}},
+            { "высокая", PiecewiseLinear{{ 17, 0 }, { 21, 1 }}},
+    });
+
+    auto sampled = LinguisticVariable("Z", {
+            { "низкая",  [](double x) -> double { return lined(x, 14, 16, 1, 0); }},
+            { "средняя", [](double x) -> double { return (x <= 17) ? lined(x, 13, 17, 0, 1) : lined(x, 18, 25, 1, 0); }},
+            { "высокая", [](double x) -> double { return lined(x, 17, 21, 0, 1); }},
+    });
+
+    const Range universe{ 10, 28 };
+    const double tolerance = 2 * (universe.r - universe.l) / (FuzzyLogicEngine::fallbackSamples - 1);
+
+    const std::vector<std::pair<std::string, std::function<std::shared_ptr<IDefuzzifier>()>>> implications = {
+            { "Zadeh",       [] { return std::make_shared<ZadehDefuzzifier>(); }},
+            { "Lukaszewicz", [] { return std::make_shared<LukaszewiczDefuzzifier>(); }},
+            { "Mamdani",     [] { return std::make_shared<MamdaniDefuzzifier>(); }},
+            { "Larsen",      [] { return std::make_shared<LarsenDefuzzifier>(); }},
+    };
+
+    const std::vector<std::pair<std::string, Defuzzification>> methods = {
+            { "centroid",           Defuzzification::Centroid },
+            { "bisector",           Defuzzification::Bisector },
+            { "mean of maxima",     Defuzzification::MeanOfMaxima },
+            { "smallest of maxima", Defuzzification::SmallestOfMaxima },
+            { "largest of maxima",  Defuzzification::LargestOfMaxima },
+    };
+
+    auto build = [&](LinguisticVariable & output, const std::shared_ptr<IDefuzzifier> & defuzzifier,
+                     Defuzzification method) {
+        FuzzyLogicEngine engine;
+        for (const auto & var : { a1, a2, a3 }) {
+            engine.addInputVariable(var);
+        }
+        engine.addOutputVariable(output, std::make_shared<MaxMinRuleAggregation>(), defuzzifier, universe, method);
+        engine.addRule((a1 == "да") >>= (output == "низкая"));
+        engine.addRule((a2 == "да") >>= (output == "средняя"));
+        engine.addRule((a3 == "да") >>= (output == "высокая"));
+        return engine;
+    };
+
+    // Value of the output, empty if the output fuzzy set is empty
+    auto run = [&](const FuzzyLogicEngine & engine, double x1, double x2, double x3) -> std::optional<double> {
+        try {
+            return engine.process({{ a1, x1 }, { a2, x2 }, { a3, x3 }}).at("Z");
+        } catch (const std::runtime_error & e) {
+            if (std::string(e.what()) != "Empty fuzzy set!") throw;
+            return std::nullopt;
+        }
+    };
+
+    int failures = 0;
+
+    // Output sets with a single active rule, integrated by hand over universe
+    struct HandCase {
+        std::string name;
+        std::function<std::shared_ptr<IDefuzzifier>()> makeDefuzzifier;
+        double x1, x2, x3;
+        std::map<Defuzzification, double> expected;
+    };
+
+    const std::vector<HandCase> handCases = {
+            // Trapezoid (13, 0), (15, 0.5), (21.5, 0.5), (25, 0)
+            { "Mamdani, средняя at 0.5", [] { return std::make_shared<MamdaniDefuzzifier>(); }, 0, 0.5, 0, {
+                    { Defuzzification::Centroid,         1381. / 74 },
+                    { Defuzzification::Bisector,         18.625 },
+                    { Defuzzification::MeanOfMaxima,     18.25 },
+                    { Defuzzification::SmallestOfMaxima, 15 },
+                    { Defuzzification::LargestOfMaxima,  21.5 },
+            }},
+            // (17, 0), (21, 0.5), (28, 0.5)
+            { "Larsen, высокая at 0.5", [] { return std::make_shared<LarsenDefuzzifier>(); }, 0, 0, 0.5, {
+                    { Defuzzification::Centroid,         1265. / 54 },
+                    { Defuzzification::Bisector,         23.5 },
+                    { Defuzzification::MeanOfMaxima,     24.5 },
+                    { Defuzzification::SmallestOfMaxima, 21 },
+                    { Defuzzification::LargestOfMaxima,  28 },
+            }},
+            // Rules with zero activation give 1 everywhere, so the set is средняя itself
+            { "Lukaszewicz, средняя at 1", [] { return std::make_shared<LukaszewiczDefuzzifier>(); }, 0, 1, 0, {
+                    { Defuzzification::Centroid,         240. / 13 },
+                    { Defuzzification::Bisector,         18 + (14 - std::sqrt(182.)) / 2 },
+                    { Defuzzification::MeanOfMaxima,     17.5 },
+                    { Defuzzification::SmallestOfMaxima, 17 },
+                    { Defuzzification::LargestOfMaxima,  18 },
+            }},
+    };
+
+    for (const auto & handCase : handCases) {
+        for (const auto & [methodName, method] : methods) {
+            auto value = run(build(exact, handCase.makeDefuzzifier(), method), handCase.x1, handCase.x2, handCase.x3);
+            auto expected = handCase.expected.at(method);
+            if (not value or std::abs(*value - expected) > 1e-9) {
+                std::cerr << handCase.name << ", " << methodName << ": " << (value ? std::to_string(*value) : "none")
+                          << ", expected " << expected << std::endl;
+                ++failures;
+            }
+        }
+    }
+
+    const std::vector<double> levels = { 0, 0.3, 0.5, 1 };
+
+    double worst = 0;
+    for (const auto & [implicationName, makeDefuzzifier] : implications) {
+        for (const auto & [methodName, method] : methods) {
+            auto exactEngine = build(exact, makeDefuzzifier(), method);
+            auto sampledEngine = build(sampled, makeDefuzzifier(), method);
+
+            for (auto x1 : levels) {
+                for (auto x2 : levels) {
+                    for (auto x3 : levels) {
+                        auto e = run(exactEngine, x1, x2, x3);
+                        auto s = run(sampledEngine, x1, x2, x3);
+                        if (e.has_value() != s.has_value() or (e and std::abs(*e - *s) > tolerance)) {
+                            std::cerr << implicationName << ", " << methodName << " (" << x1 << ", " << x2 << ", " << x3
+                                      << "): exact " << (e ? std::to_string(*e) : "none")
+                                      << ", sampled " << (s ? std::to_string(*s) : "none") << std::endl;
+                            ++failures;
+                        }
+                        if (e and s) worst = std::max(worst, std::abs(*e - *s));
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "Largest difference from sampling: " << worst << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#include "fuzzy_logic.h"
+
+#include <thread>
+
+// Readers keep calling FuzzyModelHandle::process while the main thread publishes new engines.
+// Results and engine counts are checked in every build, but a reader touching a deleted engine is only
+// reported reliably under a sanitizer: CTest also runs ModelHandleStressTsan, and
+// -DFUZZYLOGIC_SANITIZER=thread (or address) builds everything with it.
+
+static std::atomic<int> aliveEngines{ 0 };
+
+// Lives as long as the engine owning it, so it counts engines that are not deleted yet
+class CountedRuleAggregation : public MaxMinRuleAggregation {
+public:
+    CountedRuleAggregation() { ++aliveEngines; }
+
+    ~CountedRuleAggregation() { --aliveEngines; }
+};
+
+int main() {
+    // More readers than one block of slots, so that read() has to grow the slot list
+    constexpr int readers = 2 * FuzzyModelHandle::readersPerBlock + 8;
+    constexpr int versions = 500;
+
+    auto x = LinguisticVariable("X", {
+            { "малая",   PiecewiseLinear{{ 0, 1 }, { 10, 0 }}},
+            { "большая", PiecewiseLinear{{ 0, 0 }, { 10, 1 }}},
+    });
+
+    auto z = LinguisticVariable("Z", {
+            { "низкая",  PiecewiseLinear{{ 0, 1 }, { 4, 0 }}},
+            { "средняя", PiecewiseLinear{{ 2, 0 }, { 5, 1 }, { 8, 0 }}},
+            { "высокая", PiecewiseLinear{{ 6, 0 }, { 10, 1 }}},
+    });
+
+    // Even versions conclude "высокая" for large X, odd ones "средняя", so every result tells which one was used
+    auto build = [&](int version) {
+        auto engine = std::make_unique<FuzzyLogicEngine>();
+        engine->addInputVariable(x);
+        engine->addOutputVariable(z, std::make_shared<CountedRuleAggregation>(), std::make_shared<MamdaniDefuzzifier>(),
+                                  Range{ 0, 10 });
+        engine->addRule((x == "малая") >>= (z == "низкая"));
+        engine->addRule((x == "большая") >>= (z == (version % 2 == 0 ? "высокая" : "средняя")));
+        return std::unique_ptr<const FuzzyLogicEngine>(std::move(engine));
+    };
+
+    const double input = 7;
+    const double expected[2] = {
+            build(0)->process({{ x, input }}).at("Z"),
+            build(1)->process({{ x, input }}).at("Z"),
+    };
+    if (expected[0] == expected[1]) {
+        std::cerr << "Versions are indistinguishable" << std::endl;
+        return 1;
+    }
+
+    std::atomic<bool> stop{ false }, failed{ false }, release{ false };
+    std::atomic<int> holding{ 0 };
+    std::atomic<long> inferences{ 0 };
+
+    {
+        FuzzyModelHandle handle(build(0));
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < readers; ++i) {
+            threads.emplace_back([&] {
+                {
+                    // All readers hold a guard at once, then one more nested read each
+                    auto guard = handle.read();
+                    ++holding;
+                    while (not release) std::this_thread::yield();
+
+                    auto nested = handle.process({{ x, input }}).at("Z");
+                    if (nested != expected[0] and nested != expected[1]) failed = true;
+
+                    auto moved = std::move(guard);
+                    if (moved->process({{ x, input }}).at("Z") != expected[0]) failed = true;
+                }
+
+                while (not stop) {
+                    auto result = handle.process({{ x, input }}).at("Z");
+                    if (result != expected[0] and result != expected[1]) failed = true;
+                    ++inferences;
+                }
+            });
+        }
+
+        while (holding != readers) std::this_thread::yield();
+
+        // Every reader pins the first engine, so it has to survive the swap
+        handle.publish(build(1));
+        handle.reclaim();
+        if (aliveEngines != 2) {
+            std::cerr << "Engines alive while the first one is pinned: " << aliveEngines << std::endl;
+            failed = true;
+        }
+        release = true;
+
+        for (int version = 2; version < versions; ++version) {
+            handle.publish(build(version));
+        }
+
+        stop = true;
+        for (auto & thread : threads) thread.join();
+
+        handle.reclaim();
+        if (aliveEngines != 1) {
+            std::cerr << "Retired engines left after reclaim: " << aliveEngines - 1 << std::endl;
+            failed = true;
+        }
+        if (handle.process({{ x, input }}).at("Z") != expected[(versions - 1) % 2]) {
+            std::cerr << "Last published engine is not current" << std::endl;
+            failed = true;
+        }
+    }
+
+    if (aliveEngines != 0) {
+        std::cerr << "Engines left after destruction: " << aliveEngines << std::endl;
+        failed = true;
+    }
+
+    std::cout << inferences << " inferences over " << versions << " versions" << std::endl;
+    return failed ? 1 : 0;
+}